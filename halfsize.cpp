@@ -2,21 +2,32 @@
 
 #pragma warning(push)
 #pragma warning(disable:4530)
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 #pragma warning(pop)
 
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #if ! defined(_WIN32)
 #error program may not behave correctly on this platform
 // for example, it assumes little-endian Byte order and `pragma pack`
 #endif
 
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
 namespace
 {
 	////////////////////////////////////////////////////////////////////////////////
@@ -24,6 +35,7 @@ namespace
 
 	typedef std::uint8_t Byte;
 	typedef std::uint16_t Word;
+	typedef std::uint32_t DWord;
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Error handling
@@ -38,6 +50,8 @@ namespace
 		badOutputFile,
 		badInputFormat,
 		unsupportedInputFormat,
+		badCrop,
+		badSwizzle,
 		size,
 	};
 
@@ -46,15 +60,39 @@ namespace
 		nullptr,
 		nullptr,
 		nullptr,
-		"usage: halfsize.exe <input.tga> <output.tga>",
+		"usage: halfsize.exe [options] <input.tga> <output.tga>\n"
+		"options:\n"
+		"  --io-rate=MB/s     limit combined read and write rate\n"
+		"  --trace=out.json   record timings in Chrome trace-event format\n"
+		"  --postage-stamp    embed a thumbnail of at most 64x64 in the output\n"
+		"  --crop=x,y,w,h     convert only the given rectangle of the input\n"
+		"  --out-format=bpp   write 8, 16 (grey-scale), 24 or 32-bit (true-color) pixels\n"
+		"  --out-format=565|4444|1555  write 16-bit packed true-color pixels\n"
+		"  --dither           apply an ordered dither when packing pixels\n"
+		"  --swizzle=pattern  source of each output component: b, g, r, l, a, 0 or 1\n"
+		"  --grey[=709|601]   write 8-bit luminance of true-color input\n"
+		"  --grey16           treat 16-bit grey-scale pixels as single 16-bit values\n"
+		"  --reduce=op        reduce 2x2 blocks by avg (default), min, max or minmax\n"
+		"  --normalmap[=toksvig]  average 2x2 blocks as unit normal vectors\n"
+		"  --alpha-coverage=threshold  scale alpha to preserve the alpha-tested area\n"
+		"  --bleed            average only visible color and spread it into transparent blocks\n"
+		"  --axes=x|y|xy      halve only the width, only the height or both (default)\n"
+		"  --polyphase        filter odd dimensions with 3-tap polyphase weights\n",
 		"failed to open input file",
 		"failed to open output file",
 		"failed to read input file",
-		"unsupported input format"
+		"unsupported input format",
+		"crop rectangle does not lie within input image",
+		"swizzle does not match input and output formats"
 	};
 	static_assert(std::extent<decltype(errorMessages)>::value <= int(ExitStatus::size), "too many error messages");
 	static_assert(std::extent<decltype(errorMessages)>::value >= int(ExitStatus::size), "too few error messages");
 
+	// output which is still being written and must not outlive a failure;
+	// the file is null once closed and the name is empty once the output is complete
+	FILE * partialFile = nullptr;
+	std::string partialFilename;
+
 	// terminate program with given exit status
 	void fail(ExitStatus exitStatus)
 	{
@@ -63,6 +101,16 @@ namespace
 		auto errorMessage = errorMessages[static_cast<int>(exitStatus)];
 		assert(errorMessage);
 
+		// an open file cannot be removed on Windows
+		if (partialFile)
+		{
+			std::fclose(partialFile);
+		}
+		if (!partialFilename.empty())
+		{
+			std::remove(partialFilename.c_str());
+		}
+
 		std::fputs(errorMessage, stderr);
 		std::exit(static_cast<int>(exitStatus));
 	}
@@ -76,24 +124,520 @@ namespace
 		}
 	}
 
+	////////////////////////////////////////////////////////////////////////////////
+	// command-line options
+
+	// rectangle of an image in pixels, measured from the first pixel stored in the file
+	struct Region
+	{
+		Word x;
+		Word y;
+		Word width;
+		Word height;
+	};
+
+	// how each 2x2 block of input pixels is reduced to one output pixel
+	enum class Reduction
+	{
+		average,
+		minimum,
+		maximum,
+		minMax,
+		normalMap,
+	};
+
+	// which dimensions of the image are halved
+	enum class Axes
+	{
+		xy,
+		x,
+		y,
+	};
+
+	struct Options
+	{
+		Options()
+			: inFilename(nullptr)
+			, outFilename(nullptr)
+			, traceFilename(nullptr)
+			, ioRate(0)
+			, postageStamp(false)
+			, outBpp(0)
+			, swizzle(nullptr)
+			, lumaStandard(709)
+			, grey(false)
+			, packedFormat(0)
+			, dither(false)
+			, grey16(false)
+			, reduction(Reduction::average)
+			, toksvig(false)
+			, alphaThreshold(0)
+			, bleed(false)
+			, axes(Axes::xy)
+			, polyphase(false)
+		{
+			crop.x = crop.y = crop.width = crop.height = 0;
+		}
+
+		char const * inFilename;
+		char const * outFilename;
+
+		// destination of trace events; null means tracing is disabled
+		char const * traceFilename;
+
+		// combined read and write rate limit in MB/s; zero means unlimited
+		double ioRate;
+
+		// whether to add a TGA 2.0 postage stamp to the output
+		bool postageStamp;
+
+		// part of the input to convert; zero width means the whole image
+		Region crop;
+
+		// bits per output pixel; zero means as input or as implied by swizzle
+		int outBpp;
+
+		// sources of the output components; null means the natural mapping from input format
+		char const * swizzle;
+
+		// ITU-R recommendation (BT.709 or BT.601) whose weights give luminance of true-color input
+		int lumaStandard;
+
+		// whether output defaults to the luminance of the input
+		bool grey;
+
+		// bits per component of 16-bit packed output, e.g. 565; zero means components are not packed
+		int packedFormat;
+
+		// whether to dither packed output
+		bool dither;
+
+		// whether 16-bit grey-scale pixels hold a single value rather than grey and alpha
+		bool grey16;
+
+		Reduction reduction;
+
+		// whether normal map output carries the length of the averaged normal in alpha
+		bool toksvig;
+
+		// alpha test reference value whose coverage is to be preserved; zero means alpha is left as reduced
+		int alphaThreshold;
+
+		// whether the color of fully transparent pixels is replaced by that of visible neighbors
+		bool bleed;
+
+		Axes axes;
+
+		// whether an odd number of rows or columns is filtered down to one fewer than half, rounded up,
+		// without repeating the last row or column
+		bool polyphase;
+	};
+
+	// whether the reduction can be performed along one axis alone
+	bool hasAxisKernels(Options const & options)
+	{
+		return options.reduction == Reduction::average && !options.bleed && !options.grey16;
+	}
+
+	// if arg begins with prefix, points value at the remainder of arg and returns true
+	bool matchOption(char const * arg, char const * prefix, char const * & value)
+	{
+		auto prefixLength = std::strlen(prefix);
+		if (std::strncmp(arg, prefix, prefixLength) != 0)
+		{
+			return false;
+		}
+
+		value = arg + prefixLength;
+		return true;
+	}
+
+	// parse a positive, finite number which makes up the whole of value
+	double parsePositive(char const * value)
+	{
+		char * end;
+		auto number = std::strtod(value, &end);
+		enforce(end != value && *end == '\0', ExitStatus::badArgs);
+		enforce(number > 0 && number < HUGE_VAL, ExitStatus::badArgs);
+		return number;
+	}
+
+	// parse a list of four comma-separated Word values which makes up the whole of value
+	Region parseRegion(char const * value)
+	{
+		unsigned x, y, width, height;
+		int numChars = 0;
+		enforce(std::sscanf(value, "%u,%u,%u,%u%n", &x, &y, &width, &height, &numChars) == 4, ExitStatus::badArgs);
+		enforce(value[numChars] == '\0', ExitStatus::badArgs);
+		enforce(x <= UINT16_MAX && y <= UINT16_MAX, ExitStatus::badArgs);
+		enforce(width > 0 && width <= UINT16_MAX && height > 0 && height <= UINT16_MAX, ExitStatus::badArgs);
+
+		Region region = { Word(x), Word(y), Word(width), Word(height) };
+		return region;
+	}
+
+	Options parseOptions(int numArgs, char * args[])
+	{
+		Options options;
+
+		for (auto argIndex = 1; argIndex != numArgs; ++argIndex)
+		{
+			char const * arg = args[argIndex];
+			char const * value;
+
+			if (matchOption(arg, "--io-rate=", value))
+			{
+				// slower rates would owe sleeps too long to represent
+				auto const minIoRate = .001;
+				options.ioRate = parsePositive(value);
+				enforce(options.ioRate >= minIoRate, ExitStatus::badArgs);
+			}
+			else if (matchOption(arg, "--trace=", value))
+			{
+				enforce(*value != '\0', ExitStatus::badArgs);
+				options.traceFilename = value;
+			}
+			else if (std::strcmp(arg, "--postage-stamp") == 0)
+			{
+				options.postageStamp = true;
+			}
+			else if (matchOption(arg, "--crop=", value))
+			{
+				options.crop = parseRegion(value);
+			}
+			else if (matchOption(arg, "--out-format=", value))
+			{
+				if (std::strcmp(value, "565") == 0 || std::strcmp(value, "4444") == 0 || std::strcmp(value, "1555") == 0)
+				{
+					options.packedFormat = std::atoi(value);
+					options.outBpp = 0;
+				}
+				else
+				{
+					options.outBpp = std::atoi(value);
+					options.packedFormat = 0;
+					enforce(std::strcmp(value, "8") == 0 || std::strcmp(value, "16") == 0
+						|| std::strcmp(value, "24") == 0 || std::strcmp(value, "32") == 0, ExitStatus::badArgs);
+				}
+			}
+			else if (std::strcmp(arg, "--dither") == 0)
+			{
+				options.dither = true;
+			}
+			else if (std::strcmp(arg, "--grey16") == 0)
+			{
+				options.grey16 = true;
+			}
+			else if (matchOption(arg, "--reduce=", value))
+			{
+				if (std::strcmp(value, "avg") == 0)
+				{
+					options.reduction = Reduction::average;
+				}
+				else if (std::strcmp(value, "min") == 0)
+				{
+					options.reduction = Reduction::minimum;
+				}
+				else if (std::strcmp(value, "max") == 0)
+				{
+					options.reduction = Reduction::maximum;
+				}
+				else if (std::strcmp(value, "minmax") == 0)
+				{
+					options.reduction = Reduction::minMax;
+				}
+				else
+				{
+					fail(ExitStatus::badArgs);
+				}
+			}
+			else if (std::strcmp(arg, "--normalmap") == 0)
+			{
+				options.reduction = Reduction::normalMap;
+			}
+			else if (std::strcmp(arg, "--normalmap=toksvig") == 0)
+			{
+				options.reduction = Reduction::normalMap;
+				options.toksvig = true;
+			}
+			else if (matchOption(arg, "--alpha-coverage=", value))
+			{
+				// range-check before converting as out-of-range conversion is undefined
+				auto threshold = parsePositive(value);
+				enforce(threshold <= UINT8_MAX && threshold == std::floor(threshold), ExitStatus::badArgs);
+				options.alphaThreshold = static_cast<int>(threshold);
+			}
+			else if (std::strcmp(arg, "--bleed") == 0)
+			{
+				options.bleed = true;
+			}
+			else if (std::strcmp(arg, "--polyphase") == 0)
+			{
+				options.polyphase = true;
+			}
+			else if (matchOption(arg, "--axes=", value))
+			{
+				if (std::strcmp(value, "xy") == 0)
+				{
+					options.axes = Axes::xy;
+				}
+				else if (std::strcmp(value, "x") == 0)
+				{
+					options.axes = Axes::x;
+				}
+				else if (std::strcmp(value, "y") == 0)
+				{
+					options.axes = Axes::y;
+				}
+				else
+				{
+					fail(ExitStatus::badArgs);
+				}
+			}
+			else if (matchOption(arg, "--swizzle=", value))
+			{
+				enforce(*value != '\0' && std::strlen(value) <= 4, ExitStatus::badArgs);
+				options.swizzle = value;
+			}
+			else if (std::strcmp(arg, "--grey") == 0)
+			{
+				options.grey = true;
+			}
+			else if (matchOption(arg, "--grey=", value))
+			{
+				options.grey = true;
+				options.lumaStandard = std::atoi(value);
+				enforce(std::strcmp(value, "709") == 0 || std::strcmp(value, "601") == 0, ExitStatus::badArgs);
+			}
+			else if (matchOption(arg, "--", value))
+			{
+				fail(ExitStatus::badArgs);
+			}
+			else if (!options.inFilename)
+			{
+				options.inFilename = arg;
+			}
+			else if (!options.outFilename)
+			{
+				options.outFilename = arg;
+			}
+			else
+			{
+				fail(ExitStatus::badArgs);
+			}
+		}
+
+		enforce(options.outFilename != nullptr, ExitStatus::badArgs);
+
+		// the stamp is filtered per Byte, which does not suit packed components
+		enforce(!options.postageStamp || !options.packedFormat, ExitStatus::badArgs);
+
+		// only packing drops enough precision to dither
+		enforce(!options.dither || options.packedFormat, ExitStatus::badArgs);
+
+		// 16-bit values are not made up of components which can be rearranged or filtered per Byte
+		enforce(!options.grey16 || (!options.postageStamp && !options.swizzle && !options.outBpp && !options.packedFormat && !options.grey), ExitStatus::badArgs);
+
+		// the output format of minmax is fixed by the input format
+		enforce(options.reduction != Reduction::minMax || (!options.swizzle && !options.outBpp && !options.packedFormat && !options.grey), ExitStatus::badArgs);
+
+		// alpha is rescaled after the rows are written so it must be stored as reduced
+		enforce(!options.alphaThreshold || (!options.swizzle && !options.outBpp && !options.packedFormat && !options.grey
+			&& !options.postageStamp && options.reduction != Reduction::minMax && !options.toksvig), ExitStatus::badArgs);
+
+		// bleeding replaces the color of transparent pixels before they are averaged
+		enforce(!options.bleed || options.reduction == Reduction::average, ExitStatus::badArgs);
+
+		enforce(options.axes == Axes::xy || hasAxisKernels(options), ExitStatus::badArgs);
+		enforce(!options.polyphase || (options.axes == Axes::xy && hasAxisKernels(options)), ExitStatus::badArgs);
+
+		return options;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// I/O throttling
+
+	// token bucket which paces file transfers to a given number of Bytes per second;
+	// transfers are tallied as they happen but the caller only sleeps once a whole
+	// chunk is owed so that individual rows are never throttled
+	class RateLimiter
+	{
+	public:
+		RateLimiter() : bytesPerSecond(0), owed(0) { }
+
+		void setRate(double rate)
+		{
+			bytesPerSecond = rate;
+			owed = 0;
+			ready = Clock::now();
+		}
+
+		void consume(std::size_t numBytes)
+		{
+			if (bytesPerSecond <= 0)
+			{
+				return;
+			}
+
+			owed += numBytes;
+			if (owed < chunkSize)
+			{
+				return;
+			}
+
+			pay();
+		}
+
+		// sleep for any bytes which are owed but fall short of a chunk; call once transfers are over
+		void flush()
+		{
+			if (bytesPerSecond <= 0 || !owed)
+			{
+				return;
+			}
+
+			pay();
+		}
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		static std::size_t const chunkSize = 1 << 18;
+
+		// sleep until the bytes owed could have been transferred at the given rate
+		void pay()
+		{
+			// idle time does not bank credit beyond the chunk just transferred
+			auto now = Clock::now();
+			if (ready < now)
+			{
+				ready = now;
+			}
+
+			ready += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(owed / bytesPerSecond));
+			owed = 0;
+
+			std::this_thread::sleep_until(ready);
+		}
+
+		double bytesPerSecond;
+		std::size_t owed;
+		Clock::time_point ready;
+	};
+
+	// shared by all reads and writes so the limit applies to their sum
+	RateLimiter ioRateLimiter;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// tracing
+
+	// records named spans of time and exports them in Chrome trace-event format
+	class Tracer
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		Tracer() : enabled(false) { }
+
+		void enable()
+		{
+			enabled = true;
+			origin = Clock::now();
+		}
+
+		// returns the time from which a span should be measured
+		Clock::time_point now() const
+		{
+			return enabled ? Clock::now() : origin;
+		}
+
+		// records a span from begin until now and returns now,
+		// so that consecutive spans can be chained from a single clock reading each
+		Clock::time_point record(char const * name, Clock::time_point begin)
+		{
+			if (!enabled)
+			{
+				return begin;
+			}
+
+			Span span = { name, begin, Clock::now() };
+			spans.push_back(span);
+			return span.end;
+		}
+
+		// returns false on failure
+		bool write(char const * filename) const
+		{
+			FILE * traceFile = std::fopen(filename, "w");
+			if (!traceFile)
+			{
+				return false;
+			}
+
+			std::fputs("{\"traceEvents\":[", traceFile);
+
+			auto separator = "\n";
+			for (auto const & span : spans)
+			{
+				std::fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+					separator,
+					span.name,
+					Microseconds(span.begin - origin).count(),
+					Microseconds(span.end - span.begin).count());
+				separator = ",\n";
+			}
+
+			std::fputs("\n]}\n", traceFile);
+
+			return std::fclose(traceFile) == 0;
+		}
+
+	private:
+		typedef std::chrono::duration<double, std::micro> Microseconds;
+
+		struct Span
+		{
+			char const * name;
+			Clock::time_point begin;
+			Clock::time_point end;
+		};
+
+		bool enabled;
+		Clock::time_point origin;
+		std::vector<Span> spans;
+	};
+
+	Tracer tracer;
+
 	////////////////////////////////////////////////////////////////////////////////
 	// FILE helpers
 
 	// seek inFile forward a given number of Bytes
 	void skip(std::FILE * inFile, long numBytes)
 	{
-		auto pos = std::ftell(inFile);
-		std::fseek(inFile, pos + numBytes, SEEK_SET);
+		// even a null seek can cost a system call and the loss of buffered data
+		if (numBytes)
+		{
+			std::fseek(inFile, numBytes, SEEK_CUR);
+		}
 	}
 
+	// a short read is blamed on the input format unless reading back from another file
 	template <typename T>
-	void readObjects(FILE * inFile, T * objects, std::size_t numObjects)
+	void readObjects(FILE * inFile, T * objects, std::size_t numObjects, ExitStatus exitStatus = ExitStatus::badInputFormat)
 	{
+		// objects may be the null data of an empty vector
+		if (!numObjects)
+		{
+			return;
+		}
+
 		auto readCount = std::fread(reinterpret_cast<void *>(objects), sizeof(T), numObjects, inFile);
+		ioRateLimiter.consume(readCount * sizeof(T));
 
 		if (readCount != numObjects)
 		{
-			fail(ExitStatus::badInputFormat);
+			fail(exitStatus);
 		}
 	}
 
@@ -108,7 +652,13 @@ namespace
 	template <typename T>
 	void writeObjects(FILE * outFile, T const * objects, std::size_t numObjects)
 	{
+		if (!numObjects)
+		{
+			return;
+		}
+
 		auto writeCount = std::fwrite(reinterpret_cast<void const *>(objects), sizeof(T), numObjects, outFile);
+		ioRateLimiter.consume(writeCount * sizeof(T));
 
 		if (writeCount != numObjects)
 		{
@@ -122,6 +672,58 @@ namespace
 		writeObjects(outFile, &object, 1);
 	}
 
+	// create an empty file with a unique name in the directory of filename, from which it can be moved over filename
+	std::string createTempFile(char const * filename)
+	{
+		std::string directory(filename);
+		auto separatorPosition = directory.find_last_of("\\/:");
+		directory = separatorPosition == std::string::npos ? "." : directory.substr(0, separatorPosition + 1);
+
+		char tempFilename[MAX_PATH];
+		enforce(GetTempFileNameA(directory.c_str(), "hs", 0, tempFilename) != 0, ExitStatus::badOutputFile);
+		return tempFilename;
+	}
+
+	// positions are 64-bit as a long cannot hold those of files of 2 GiB or more on Windows
+	typedef std::int64_t FilePosition;
+
+	FilePosition tell(FILE * file, ExitStatus exitStatus)
+	{
+		auto position = _ftelli64(file);
+		enforce(position >= 0, exitStatus);
+		return position;
+	}
+
+	void seek(FILE * file, FilePosition position, ExitStatus exitStatus)
+	{
+		enforce(_fseeki64(file, position, SEEK_SET) == 0, exitStatus);
+	}
+
+	// position of the end of file; the current position is unchanged
+	FilePosition endPosition(FILE * file, ExitStatus exitStatus)
+	{
+		auto position = tell(file, exitStatus);
+		enforce(_fseeki64(file, 0, SEEK_END) == 0, exitStatus);
+		auto end = tell(file, exitStatus);
+		seek(file, position, exitStatus);
+		return end;
+	}
+
+	// copy numBytes from inFile to outFile through a fixed-size buffer
+	void copyBytes(FILE * inFile, FILE * outFile, FilePosition numBytes)
+	{
+		FilePosition const maxChunkSize = 1 << 16;
+		std::vector<Byte> chunk(static_cast<std::size_t>(std::min(numBytes, maxChunkSize)));
+
+		for (; numBytes; )
+		{
+			auto chunkSize = static_cast<std::size_t>(std::min(numBytes, maxChunkSize));
+			readObjects(inFile, chunk.data(), chunkSize);
+			writeObjects(outFile, chunk.data(), chunkSize);
+			numBytes -= chunkSize;
+		}
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
 	// TGA
 
@@ -174,8 +776,54 @@ namespace
 	static_assert(sizeof(Header::ColorMapSpecification) == 5, "Header::Specification does not match TGA format");
 	static_assert(sizeof(Header::Specification) == 10, "Header::Specification does not match TGA format");
 	static_assert(sizeof(Header) == 18, "Header does not match TGA format");
+
+	// TGA 2.0 file footer; locates the optional extension area and developer directory
+	struct Footer
+	{
+		DWord extensionAreaOffset;
+		DWord developerDirectoryOffset;
+		std::array<char, 18> signature;
+	};
+
+	// TGA 2.0 extension area
+	struct ExtensionArea
+	{
+		Word size;
+		std::array<char, 41> authorName;
+		std::array<char, 324> authorComments;
+		std::array<Word, 6> timeStamp;
+		std::array<char, 41> jobName;
+		std::array<Word, 3> jobTime;
+		std::array<char, 41> softwareId;
+		std::array<Byte, 3> softwareVersion;
+		DWord keyColor;
+		std::array<Word, 2> pixelAspectRatio;
+		std::array<Word, 2> gamma;
+		DWord colorCorrectionOffset;
+		DWord postageStampOffset;
+		DWord scanLineOffset;
+		Byte attributesType;
+	};
+
+	// TGA 2.0 developer directory entry
+	struct DeveloperTag
+	{
+		Word tag;
+		DWord offset;
+		DWord size;
+	};
+
+	static_assert(sizeof(Footer) == 26, "Footer does not match TGA format");
+	static_assert(sizeof(ExtensionArea) == 495, "ExtensionArea does not match TGA format");
+	static_assert(sizeof(DeveloperTag) == 10, "DeveloperTag does not match TGA format");
 #pragma pack(pop)
 
+	char const footerSignature[] = "TRUEVISION-XFILE.";
+	static_assert(sizeof(footerSignature) == std::tuple_size<decltype(Footer::signature)>::value, "footerSignature does not match TGA format");
+
+	// size of the color correction table referenced by the extension area
+	std::size_t const colorCorrectionTableSize = 256 * 4 * sizeof(Word);
+
 	// represents grey-scale/true-color TGA pixel
 	template <int numComponents>
 	class Pixel : public std::array<Byte, numComponents> {};
@@ -211,19 +859,207 @@ namespace
 		enforce(header.specification.descriptor.interleave == 0, ExitStatus::unsupportedInputFormat);
 	}
 
-	template <int numComponents>
-	void readRow(
-		FILE * inFile,
-		Row<numComponents> & row,
-		int inWidth)
+	// copy everything following the pixels from the current position of inFile to the current position of outFile;
+	// the absolute file offsets in a TGA 2.0 trailer are rebased, while TGA 1.0 trailers, which have no footer, are copied untouched;
+	// unless pixelsPreserved, fields which depend on the input pixel format are dropped or updated;
+	// unless stampPreserved, the input postage stamp is dropped as it no longer depicts the output;
+	// the pixel aspect ratio is widened or narrowed if only one of the axes was reduced;
+	// a non-null postageStamp is appended and referenced from the extension area, which is added if necessary
+	void copyTrailer(FILE * inFile, FILE * outFile, bool pixelsPreserved, bool stampPreserved, bool widthReduced, bool heightReduced, int outAttributeBits, std::vector<Byte> const * postageStamp)
 	{
-		readObjects(inFile, row.data(), inWidth);
+		auto inPosition = tell(inFile, ExitStatus::badInputFormat);
+		auto outPosition = tell(outFile, ExitStatus::badOutputFile);
+		auto inEnd = endPosition(inFile, ExitStatus::badInputFormat);
 
-		// account for odd column by writing value twice
-		row.back() = row[inWidth - 1];
-	}
+		// skipping past the end is only discovered here
+		enforce(inEnd >= inPosition, ExitStatus::badInputFormat);
 
-	template <int numComponents>
+		auto const footerSize = static_cast<FilePosition>(sizeof(Footer));
+		Footer footer;
+		std::memset(&footer, 0, sizeof(footer));
+		std::copy(std::begin(footerSignature), std::end(footerSignature), std::begin(footer.signature));
+
+		auto hasFooter = false;
+		if (inEnd - inPosition >= footerSize)
+		{
+			seek(inFile, inEnd - footerSize, ExitStatus::badInputFormat);
+			auto inFooter = readObject<Footer>(inFile);
+			seek(inFile, inPosition, ExitStatus::badInputFormat);
+
+			hasFooter = std::memcmp(inFooter.signature.data(), footerSignature, sizeof(footerSignature)) == 0;
+			if (hasFooter)
+			{
+				footer = inFooter;
+			}
+		}
+
+		// everything up to the footer is copied verbatim;
+		// only the objects which the footer references are read back and patched
+		auto bodySize = inEnd - inPosition - (hasFooter ? footerSize : 0);
+		copyBytes(inFile, outFile, bodySize);
+		auto outEnd = outPosition + bodySize;
+
+		if (!hasFooter && !postageStamp)
+		{
+			return;
+		}
+
+		// true iff an object of the given size at the given input file offset lies within the body
+		auto locate = [&](DWord offset, FilePosition size) -> bool
+		{
+			return offset >= inPosition && size <= bodySize && offset - inPosition <= bodySize - size;
+		};
+
+		// output file offset of the given position, or none if it is beyond the reach of a DWord
+		auto toOffset = [](FilePosition position) -> DWord
+		{
+			return position <= UINT32_MAX ? static_cast<DWord>(position) : 0;
+		};
+
+		// translate the file offset of an object of the given size;
+		// references to anything outside the body are dropped rather than left dangling
+		auto rebase = [&](DWord offset, FilePosition size) -> DWord
+		{
+			return locate(offset, size) ? toOffset(offset - inPosition + outPosition) : 0;
+		};
+
+		ExtensionArea extensionArea;
+		std::memset(&extensionArea, 0, sizeof(extensionArea));
+		extensionArea.size = sizeof(ExtensionArea);
+
+		// position in the output of the extension area, if any, which is written once all its fields are known
+		FilePosition extensionAreaPosition = 0;
+
+		if (hasFooter)
+		{
+			if (locate(footer.extensionAreaOffset, sizeof(ExtensionArea)))
+			{
+				seek(inFile, footer.extensionAreaOffset, ExitStatus::badInputFormat);
+				auto inExtensionArea = readObject<ExtensionArea>(inFile);
+				if (inExtensionArea.size >= sizeof(ExtensionArea))
+				{
+					extensionArea = inExtensionArea;
+					extensionAreaPosition = footer.extensionAreaOffset - inPosition + outPosition;
+
+					extensionArea.colorCorrectionOffset = rebase(extensionArea.colorCorrectionOffset, colorCorrectionTableSize);
+					extensionArea.postageStampOffset = stampPreserved ? rebase(extensionArea.postageStampOffset, 2 * sizeof(Byte)) : 0;
+
+					// the table indexes input rows, none of which survive conversion
+					extensionArea.scanLineOffset = 0;
+
+					// double the ratio of pixel width to height, or clear it if neither term can give
+					auto stretch = [](Word & numerator, Word & denominator)
+					{
+						if (!numerator || !denominator)
+						{
+							return;
+						}
+
+						if (numerator <= UINT16_MAX / 2)
+						{
+							numerator *= 2;
+						}
+						else if (!(denominator & 1))
+						{
+							denominator /= 2;
+						}
+						else
+						{
+							numerator = denominator = 0;
+						}
+					};
+
+					auto & pixelAspectRatio = extensionArea.pixelAspectRatio;
+					if (widthReduced && !heightReduced)
+					{
+						stretch(pixelAspectRatio[0], pixelAspectRatio[1]);
+					}
+					else if (heightReduced && !widthReduced)
+					{
+						stretch(pixelAspectRatio[1], pixelAspectRatio[0]);
+					}
+
+					// the key color and attributes type describe the input pixel format
+					if (!pixelsPreserved)
+					{
+						auto const usefulAlpha = 3;
+						auto const retainedAlpha = 2;
+
+						extensionArea.keyColor = 0;
+						extensionArea.attributesType = static_cast<Byte>(!outAttributeBits
+							? 0
+							: extensionArea.attributesType >= usefulAlpha ? extensionArea.attributesType : retainedAlpha);
+					}
+				}
+			}
+
+			if (locate(footer.developerDirectoryOffset, sizeof(Word)))
+			{
+				seek(inFile, footer.developerDirectoryOffset, ExitStatus::badInputFormat);
+				auto numTags = readObject<Word>(inFile);
+
+				// tags which would overlap the footer are left as they are
+				auto tagsSize = bodySize - (footer.developerDirectoryOffset - inPosition) - static_cast<FilePosition>(sizeof(Word));
+				auto maxTags = tagsSize / static_cast<FilePosition>(sizeof(DeveloperTag));
+				std::vector<DeveloperTag> tags(static_cast<std::size_t>(std::min(static_cast<FilePosition>(numTags), maxTags)), DeveloperTag());
+				readObjects(inFile, tags.data(), tags.size());
+
+				for (auto & tag : tags)
+				{
+					tag.offset = rebase(tag.offset, tag.size);
+					if (!tag.offset)
+					{
+						tag.size = 0;
+					}
+				}
+
+				seek(outFile, footer.developerDirectoryOffset - inPosition + outPosition + sizeof(Word), ExitStatus::badOutputFile);
+				writeObjects(outFile, tags.data(), tags.size());
+			}
+
+			footer.extensionAreaOffset = rebase(footer.extensionAreaOffset, sizeof(Word));
+			footer.developerDirectoryOffset = rebase(footer.developerDirectoryOffset, sizeof(Word));
+		}
+
+		// new objects go at the end, immediately before the footer, which must remain last
+		if (postageStamp)
+		{
+			if (!extensionAreaPosition)
+			{
+				extensionAreaPosition = outEnd;
+				footer.extensionAreaOffset = toOffset(outEnd);
+				outEnd += sizeof(ExtensionArea);
+			}
+
+			seek(outFile, outEnd, ExitStatus::badOutputFile);
+			writeObjects(outFile, postageStamp->data(), postageStamp->size());
+			extensionArea.postageStampOffset = toOffset(outEnd);
+			outEnd += postageStamp->size();
+		}
+
+		if (extensionAreaPosition)
+		{
+			seek(outFile, extensionAreaPosition, ExitStatus::badOutputFile);
+			writeObject(outFile, extensionArea);
+		}
+
+		seek(outFile, outEnd, ExitStatus::badOutputFile);
+		writeObject(outFile, footer);
+	}
+
+	template <int numComponents>
+	void readRow(
+		FILE * inFile,
+		Row<numComponents> & row,
+		int inWidth)
+	{
+		readObjects(inFile, row.data(), inWidth);
+
+		// account for odd column by writing value twice
+		row.back() = row[inWidth - 1];
+	}
+
+	template <int numComponents>
 	void writeRow(
 		FILE * outFile,
 		Row<numComponents> const & row)
@@ -231,113 +1067,1469 @@ namespace
 		writeObjects(outFile, row.data(), row.size());
 	}
 
-	////////////////////////////////////////////////////////////////////////////////
-	// conversion
+	// optional TGA 2.0 extension area objects which are generated along with the output pixels
+	struct Extensions
+	{
+		std::vector<Byte> postageStamp;
+	};
+
+	// box-filters the rows of an image as they are produced
+	// into a TGA 2.0 postage stamp no larger than 64x64
+	template <int numComponents>
+	class PostageStamp
+	{
+	public:
+		PostageStamp(int width, int height)
+			: imageWidth(width)
+			, imageHeight(height)
+			, scale(1)
+			, rowIndex(0)
+		{
+			// a power of two scale gives the same cells as a chain of halvings would
+			while (width > maxSize * scale || height > maxSize * scale)
+			{
+				scale *= 2;
+			}
+
+			stampWidth = (width + scale - 1) / scale;
+			stampHeight = (height + scale - 1) / scale;
+			sums.resize(stampWidth * stampHeight * numComponents);
+		}
+
+		void add(Row<numComponents> const & row)
+		{
+			assert(int(row.size()) == imageWidth);
+			assert(rowIndex < imageHeight);
+
+			auto rowSums = std::begin(sums) + (rowIndex / scale) * stampWidth * numComponents;
+			for (auto columnIndex = 0; columnIndex != imageWidth; ++columnIndex)
+			{
+				auto pixel = row[columnIndex];
+				auto cellSums = rowSums + (columnIndex / scale) * numComponents;
+				for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+				{
+					cellSums[componentIndex] += pixel[componentIndex];
+				}
+			}
+
+			++rowIndex;
+		}
+
+		// stamp as stored in a TGA file: width and height Bytes followed by pixels
+		std::vector<Byte> serialize() const
+		{
+			assert(rowIndex == imageHeight);
+
+			std::vector<Byte> serialized;
+			serialized.reserve(2 + sums.size());
+			serialized.push_back(static_cast<Byte>(stampWidth));
+			serialized.push_back(static_cast<Byte>(stampHeight));
+
+			auto cellSums = std::begin(sums);
+			for (auto y = 0; y != stampHeight; ++y)
+			{
+				auto cellHeight = std::min(scale, imageHeight - y * scale);
+				for (auto x = 0; x != stampWidth; ++x)
+				{
+					auto cellWidth = std::min(scale, imageWidth - x * scale);
+					auto cellArea = DWord(cellWidth * cellHeight);
+					for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+					{
+						serialized.push_back(static_cast<Byte>((*cellSums++ + cellArea / 2) / cellArea));
+					}
+				}
+			}
+
+			assert(cellSums == std::end(sums));
+			return serialized;
+		}
+
+	private:
+		static int const maxSize = 64;
+
+		int imageWidth;
+		int imageHeight;
+		int scale;
+		int stampWidth;
+		int stampHeight;
+		int rowIndex;
+
+		// per-cell totals of each component
+		std::vector<DWord> sums;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// output formats
+
+	// arrangements of 16-bit packed true-color pixels, named from most to least significant bit
+	enum class Packing
+	{
+		none,
+		rgb565,
+		argb4444,
+		argb1555,
+	};
+
+	// describes how an output pixel is derived from an input pixel
+	struct OutputFormat
+	{
+		// for each output component, the index of the input component it is copied from;
+		// indices beyond the last possible input component select constants or luminance;
+		// when packing, the components are blue, green, red and alpha
+		std::array<int, 4> sources;
+
+		// 16-bit fixed-point weights of blue, green and red which sum to one
+		std::array<DWord, 3> lumaWeights;
+
+		Packing packing;
+
+		// whether packed components are quantized with an ordered dither
+		bool dither;
+	};
+
+	int const swizzleZero = 4;
+	int const swizzleOne = 5;
+	int const swizzleLuma = 6;
+
+	// fixed-point luminance weights of blue, green and red for the given ITU-R recommendation
+	std::array<DWord, 3> lumaWeights(int standard)
+	{
+		std::array<DWord, 3> weights;
+		switch (standard)
+		{
+		case 601:
+			weights[0] = 7471;
+			weights[1] = 38470;
+			weights[2] = 19595;
+			break;
+
+		default:
+			assert(standard == 709);
+			weights[0] = 4732;
+			weights[1] = 46871;
+			weights[2] = 13933;
+			break;
+		}
+
+		assert(weights[0] + weights[1] + weights[2] == 1 << 16);
+		return weights;
+	}
+
+	// threshold in 32nds above which a component is rounded up when quantized;
+	// dithering varies it over a 4x4 Bayer matrix, otherwise it rounds to nearest
+	int quantizationThreshold(bool dither, int x, int y)
+	{
+		static int const bayerMatrix[4][4] =
+		{
+			{ 0, 8, 2, 10 },
+			{ 12, 4, 14, 6 },
+			{ 3, 11, 1, 9 },
+			{ 15, 7, 13, 5 },
+		};
+
+		return dither ? bayerMatrix[y & 3][x & 3] * 2 + 1 : 16;
+	}
+
+	// reduce an 8-bit component to the given number of bits
+	Word quantize(Byte component, int numBits, int threshold)
+	{
+		auto maxLevel = (1 << numBits) - 1;
+		return static_cast<Word>((component * maxLevel * 32 + threshold * UINT8_MAX) / (UINT8_MAX * 32));
+	}
+
+	Word pack(Packing packing, Byte b, Byte g, Byte r, Byte a, int threshold)
+	{
+		switch (packing)
+		{
+		case Packing::rgb565:
+			return Word(quantize(r, 5, threshold) << 11 | quantize(g, 6, threshold) << 5 | quantize(b, 5, threshold));
+
+		case Packing::argb4444:
+			return Word(quantize(a, 4, threshold) << 12 | quantize(r, 4, threshold) << 8 | quantize(g, 4, threshold) << 4 | quantize(b, 4, threshold));
+
+		case Packing::argb1555:
+			return Word(quantize(a, 1, threshold) << 15 | quantize(r, 5, threshold) << 10 | quantize(g, 5, threshold) << 5 | quantize(b, 5, threshold));
+
+		default:
+			assert(false);
+			return 0;
+		}
+	}
+
+	// pattern which maps each component of the input to the same component of an output
+	// with the given number of components, e.g. adding opaque alpha or replicating grey
+	char const * naturalSwizzle(int outComponents)
+	{
+		char const * const patterns[] = { "l", "la", "bgr", "bgra" };
+		return patterns[outComponents - 1];
+	}
+
+	// whether format stores each pixel of an input with the given number of components exactly as it is read
+	bool preservesPixels(OutputFormat const & format, int numComponents)
+	{
+		if (format.packing != Packing::none)
+		{
+			return false;
+		}
+
+		for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+		{
+			if (format.sources[componentIndex] != componentIndex)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// interpret pattern, each character of which names the source of one output component,
+	// for an input with the given number of components; returns false if pattern is invalid
+	bool parseSwizzle(char const * pattern, int inComponents, OutputFormat & format)
+	{
+		auto isGrey = inComponents <= 2;
+		auto hasAlpha = (inComponents & 1) == 0;
+
+		auto patternLength = std::strlen(pattern);
+		if (patternLength > format.sources.size())
+		{
+			return false;
+		}
+
+		for (auto componentIndex = 0; componentIndex != int(patternLength); ++componentIndex)
+		{
+			int source;
+			switch (pattern[componentIndex])
+			{
+			case 'b':
+				source = 0;
+				break;
+			case 'g':
+				source = isGrey ? 0 : 1;
+				break;
+			case 'r':
+				source = isGrey ? 0 : 2;
+				break;
+			case 'l':
+				source = isGrey ? 0 : swizzleLuma;
+				break;
+			case 'a':
+				source = hasAlpha ? inComponents - 1 : swizzleOne;
+				break;
+			case '0':
+				source = swizzleZero;
+				break;
+			case '1':
+				source = swizzleOne;
+				break;
+			default:
+				return false;
+			}
+
+			format.sources[componentIndex] = source;
+		}
+
+		return true;
+	}
+
+	// rearrange, and possibly pack, the components of each pixel in inRow into outRow,
+	// which is the row with the given index in the output image
+	template <int inComponents, int outComponents>
+	Row<outComponents> const & storeRow(
+		Row<inComponents> const & inRow,
+		Row<outComponents> & outRow,
+		OutputFormat const & format,
+		int rowIndex)
+	{
+		assert(inRow.size() == outRow.size());
+		assert(format.packing == Packing::none || outComponents == sizeof(Word));
+
+		auto sourceIndices = format.sources;
+		auto numSources = format.packing == Packing::none ? outComponents : int(sourceIndices.size());
+		auto usesLuma = std::find(std::begin(sourceIndices), std::begin(sourceIndices) + numSources, swizzleLuma)
+			!= std::begin(sourceIndices) + numSources;
+
+		// input components followed by the constants and luminance
+		std::array<Byte, swizzleLuma + 1> sources;
+		sources[swizzleZero] = 0;
+		sources[swizzleOne] = UINT8_MAX;
+
+		auto outPixelIterator = std::begin(outRow);
+		auto columnIndex = 0;
+		for (auto const & inPixel : inRow)
+		{
+			std::copy(std::begin(inPixel), std::end(inPixel), std::begin(sources));
+
+			if (usesLuma)
+			{
+				auto const half = DWord(1) << 15;
+				sources[swizzleLuma] = static_cast<Byte>((format.lumaWeights[0] * inPixel[0]
+					+ format.lumaWeights[1] * inPixel[1]
+					+ format.lumaWeights[2] * inPixel[2]
+					+ half) >> 16);
+			}
+
+			auto & outPixel = *outPixelIterator++;
+			if (format.packing == Packing::none)
+			{
+				for (auto componentIndex = 0; componentIndex != outComponents; ++componentIndex)
+				{
+					outPixel[componentIndex] = sources[sourceIndices[componentIndex]];
+				}
+			}
+			else
+			{
+				auto packed = pack(
+					format.packing,
+					sources[sourceIndices[0]],
+					sources[sourceIndices[1]],
+					sources[sourceIndices[2]],
+					sources[sourceIndices[3]],
+					quantizationThreshold(format.dither, columnIndex, rowIndex));
+				std::memcpy(outPixel.data(), &packed, sizeof(packed));
+			}
+
+			++columnIndex;
+		}
+
+		return outRow;
+	}
+
+	// as above but when formats match, the common case of an identity swizzle is free
+	template <int numComponents>
+	Row<numComponents> const & storeRow(
+		Row<numComponents> const & inRow,
+		Row<numComponents> & outRow,
+		OutputFormat const & format,
+		int rowIndex)
+	{
+		return preservesPixels(format, numComponents)
+			? inRow
+			: storeRow<numComponents, numComponents>(inRow, outRow, format, rowIndex);
+	}
+
+	// preserves the proportion of pixels which pass an alpha test with a given reference value
+	// by scaling the alpha of the output so its coverage matches that of the input
+	class AlphaCoverage
+	{
+	public:
+		AlphaCoverage(int alphaThreshold)
+			: threshold(alphaThreshold)
+			, numInPixels(0)
+			, numInPixelsCovered(0)
+		{
+			outHistogram.fill(0);
+		}
+
+		// tally the first width pixels of an input row
+		template <int numComponents>
+		void addInput(Row<numComponents> const & row, int width)
+		{
+			for (auto pixelIterator = std::begin(row); pixelIterator != std::begin(row) + width; ++pixelIterator)
+			{
+				if ((*pixelIterator)[numComponents - 1] >= threshold)
+				{
+					++numInPixelsCovered;
+				}
+			}
+
+			numInPixels += width;
+		}
+
+		template <int numComponents>
+		void addOutput(Row<numComponents> const & row)
+		{
+			for (auto const & pixel : row)
+			{
+				++outHistogram[pixel[numComponents - 1]];
+			}
+		}
+
+		// lowest output alpha which should pass the test once scaled;
+		// found by walking down the histogram to the count closest to the input coverage
+		int cutoff() const
+		{
+			DWord numOutPixels = 0;
+			for (auto count : outHistogram)
+			{
+				numOutPixels += count;
+			}
+
+			auto target = double(numInPixelsCovered) * numOutPixels / numInPixels;
+			auto best = UINT8_MAX + 1;
+			auto bestError = target;
+
+			DWord numOutPixelsCovered = 0;
+			for (auto alpha = UINT8_MAX; alpha >= 1; --alpha)
+			{
+				numOutPixelsCovered += outHistogram[alpha];
+
+				auto error = std::abs(numOutPixelsCovered - target);
+				if (error < bestError)
+				{
+					best = alpha;
+					bestError = error;
+				}
+			}
+
+			return best;
+		}
+
+		// scale the alpha of each pixel in row so that exactly those from cutoff up pass the test
+		template <int numComponents>
+		void apply(Row<numComponents> & row, int cutoff) const
+		{
+			for (auto & pixel : row)
+			{
+				auto & alpha = pixel[numComponents - 1];
+				alpha = static_cast<Byte>(std::min(alpha * threshold / cutoff, int(UINT8_MAX)));
+			}
+		}
+
+		int getThreshold() const
+		{
+			return threshold;
+		}
+
+	private:
+		int threshold;
+		DWord numInPixels;
+		DWord numInPixelsCovered;
+		std::array<DWord, UINT8_MAX + 1> outHistogram;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// conversion
+
+	template <int numComponents>
+	void convert(
+		Row<numComponents> const & inRows0,
+		Row<numComponents> const & inRows1,
+		Row<numComponents> & outRow)
+	{
+		assert(inRows0.size() == inRows1.size());
+		assert(inRows0.size() == outRow.size() * 2);
+
+		auto inPixelIterator0 = std::begin(inRows0);
+		auto inPixelIterator1 = std::begin(inRows1);
+		auto outPixelIterator = std::begin(outRow);
+
+		while (inPixelIterator0 != std::end(inRows0))
+		{
+			// accumulates component values from the four input pixels
+			Accumulator<numComponents> accumulator;
+
+			// initialize accumulator with a .5 value;
+			// facilitates round-to-nearest behavior
+			auto const accumulatedUnit = 4;
+			auto const accumulatedHalf = accumulatedUnit / 2;
+			std::fill(std::begin(accumulator), std::end(accumulator), accumulatedHalf);
+
+			auto accumulate = [&](Pixel<numComponents> pixel)
+			{
+				for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+				{
+					accumulator[componentIndex] += pixel[componentIndex];
+				}
+			};
+
+			accumulate(*inPixelIterator0++);
+			accumulate(*inPixelIterator0++);
+			accumulate(*inPixelIterator1++);
+			accumulate(*inPixelIterator1++);
+
+			Pixel<numComponents> outPixel;
+			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+			{
+				outPixel[componentIndex] = accumulator[componentIndex] >> 2;
+			}
+
+			*outPixelIterator++ = outPixel;
+		}
+
+		assert(inPixelIterator0 == std::end(inRows0));
+		assert(inPixelIterator1 == std::end(inRows1));
+		assert(outPixelIterator == std::end(outRow));
+	}
+
+	// as above but pixels with zero alpha, whose color is never seen, are left out of the color average;
+	// blocks with no visible pixels take the average color of the visible pixels in the columns either side
+	// and, unless aboveRow is null, in the input row before the pair
+	// so that edge color spreads out into transparent areas instead of transparent color spreading in
+	template <int numComponents>
+	void convertBleed(
+		Row<numComponents> const & inRows0,
+		Row<numComponents> const & inRows1,
+		Row<numComponents> const * aboveRow,
+		Row<numComponents> & outRow)
+	{
+		assert(inRows0.size() == inRows1.size());
+		assert(!aboveRow || aboveRow->size() == inRows0.size());
+		assert(inRows0.size() == outRow.size() * 2);
+
+		auto const alphaIndex = numComponents - 1;
+		auto const numInColumns = int(inRows0.size());
+
+		for (auto outColumn = 0; outColumn != int(outRow.size()); ++outColumn)
+		{
+			auto const inColumn = outColumn * 2;
+
+			// sums of the four input pixels and of those which are visible
+			Accumulator<numComponents> accumulator;
+			Accumulator<numComponents> visibleAccumulator;
+			std::fill(std::begin(accumulator), std::end(accumulator), 2);
+			std::fill(std::begin(visibleAccumulator), std::end(visibleAccumulator), 0);
+			auto numVisible = 0;
+
+			auto accumulateVisible = [&](Pixel<numComponents> const & pixel)
+			{
+				if (pixel[alphaIndex])
+				{
+					for (auto componentIndex = 0; componentIndex != alphaIndex; ++componentIndex)
+					{
+						visibleAccumulator[componentIndex] += pixel[componentIndex];
+					}
+
+					++numVisible;
+				}
+			};
+
+			auto accumulate = [&](Pixel<numComponents> const & pixel)
+			{
+				for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+				{
+					accumulator[componentIndex] += pixel[componentIndex];
+				}
+
+				accumulateVisible(pixel);
+			};
+
+			accumulate(inRows0[inColumn]);
+			accumulate(inRows0[inColumn + 1]);
+			accumulate(inRows1[inColumn]);
+			accumulate(inRows1[inColumn + 1]);
+
+			if (!numVisible)
+			{
+				if (inColumn > 0)
+				{
+					accumulateVisible(inRows0[inColumn - 1]);
+					accumulateVisible(inRows1[inColumn - 1]);
+				}
+
+				if (inColumn + 2 < numInColumns)
+				{
+					accumulateVisible(inRows0[inColumn + 2]);
+					accumulateVisible(inRows1[inColumn + 2]);
+				}
+
+				if (aboveRow)
+				{
+					accumulateVisible((*aboveRow)[inColumn]);
+					accumulateVisible((*aboveRow)[inColumn + 1]);
+				}
+			}
+
+			auto & outPixel = outRow[outColumn];
+			for (auto componentIndex = 0; componentIndex != alphaIndex; ++componentIndex)
+			{
+				outPixel[componentIndex] = static_cast<Byte>(numVisible
+					? (visibleAccumulator[componentIndex] + numVisible / 2) / numVisible
+					: accumulator[componentIndex] >> 2);
+			}
+
+			outPixel[alphaIndex] = static_cast<Byte>(accumulator[alphaIndex] >> 2);
+		}
+	}
+
+	// as above but for rows of 16-bit grey-scale values stored as little-endian Words
+	void convertGrey16(
+		Row<2> const & inRows0,
+		Row<2> const & inRows1,
+		Row<2> & outRow)
+	{
+		assert(inRows0.size() == inRows1.size());
+		assert(inRows0.size() == outRow.size() * 2);
+
+		auto inPixelIterator0 = std::begin(inRows0);
+		auto inPixelIterator1 = std::begin(inRows1);
+
+		auto value = [](Pixel<2> const & pixel)
+		{
+			return DWord(pixel[0] | (pixel[1] << 8));
+		};
+
+		for (auto & outPixel : outRow)
+		{
+			// a Word cannot hold the sum of four Words
+			DWord accumulator = 2;
+			accumulator += value(*inPixelIterator0++);
+			accumulator += value(*inPixelIterator0++);
+			accumulator += value(*inPixelIterator1++);
+			accumulator += value(*inPixelIterator1++);
+			accumulator >>= 2;
+
+			outPixel[0] = static_cast<Byte>(accumulator);
+			outPixel[1] = static_cast<Byte>(accumulator >> 8);
+		}
+
+		assert(inPixelIterator0 == std::end(inRows0));
+		assert(inPixelIterator1 == std::end(inRows1));
+	}
+
+	// average each 2x2 block of a tangent-space normal map as unit vectors; blue, green and red
+	// are decoded to z, y and x in [-1, 1], summed, renormalized and re-encoded;
+	// alpha, if any, is averaged or, if toksvig is set, replaced with the length of the average
+	// which, being shorter where normals diverge, can be used to attenuate specular highlights
+	template <int numComponents>
+	void convertNormals(
+		Row<numComponents> const & inRows0,
+		Row<numComponents> const & inRows1,
+		Row<numComponents> & outRow,
+		bool toksvig)
+	{
+		assert(inRows0.size() == inRows1.size());
+		assert(inRows0.size() == outRow.size() * 2);
+
+		auto const numAxes = numComponents < 3 ? numComponents : 3;
+		auto const hasAlpha = numComponents == 4;
+
+		auto inPixelIterator0 = std::begin(inRows0);
+		auto inPixelIterator1 = std::begin(inRows1);
+
+		for (auto & outPixel : outRow)
+		{
+			Pixel<numComponents> const * block[] = { &inPixelIterator0[0], &inPixelIterator0[1], &inPixelIterator1[0], &inPixelIterator1[1] };
+			inPixelIterator0 += 2;
+			inPixelIterator1 += 2;
+
+			// sums of the vectors scaled by 255, which renormalization cancels out
+			std::array<int, 3> sums = { { 0, 0, 0 } };
+			auto alphaSum = 2;
+			for (auto pixel : block)
+			{
+				for (auto axis = 0; axis != numAxes; ++axis)
+				{
+					sums[axis] += 2 * (*pixel)[axis] - UINT8_MAX;
+				}
+
+				if (hasAlpha)
+				{
+					alphaSum += (*pixel)[numComponents - 1];
+				}
+			}
+
+			auto squaredLength = 0.f;
+			for (auto axis = 0; axis != numAxes; ++axis)
+			{
+				squaredLength += float(sums[axis]) * float(sums[axis]);
+			}
+
+			if (squaredLength > 0)
+			{
+				auto reciprocalLength = 1.f / std::sqrt(squaredLength);
+				for (auto axis = 0; axis != numAxes; ++axis)
+				{
+					auto encoded = (float(sums[axis]) * reciprocalLength + 1.f) * (UINT8_MAX * .5f) + .5f;
+					outPixel[axis] = static_cast<Byte>(std::min(std::max(encoded, 0.f), float(UINT8_MAX)));
+				}
+			}
+			else
+			{
+				// opposing normals cancel out; face straight out of the surface
+				for (auto axis = 0; axis != numAxes; ++axis)
+				{
+					outPixel[axis] = axis ? (UINT8_MAX + 1) / 2 : UINT8_MAX;
+				}
+			}
+
+			if (hasAlpha)
+			{
+				auto const maxLength = 4.f * UINT8_MAX;
+				outPixel[numComponents - 1] = toksvig
+					? static_cast<Byte>(std::min(std::sqrt(squaredLength) / maxLength, 1.f) * UINT8_MAX + .5f)
+					: static_cast<Byte>(alphaSum >> 2);
+			}
+		}
+
+		assert(inPixelIterator0 == std::end(inRows0));
+		assert(inPixelIterator1 == std::end(inRows1));
+	}
+
+	// select the lowest or highest of each component in each 2x2 block,
+	// according to whether compare is std::less or std::greater
+	template <int numComponents, typename Compare>
+	void select(
+		Row<numComponents> const & inRows0,
+		Row<numComponents> const & inRows1,
+		Row<numComponents> & outRow,
+		Compare compare)
+	{
+		assert(inRows0.size() == inRows1.size());
+		assert(inRows0.size() == outRow.size() * 2);
+
+		auto inPixelIterator0 = std::begin(inRows0);
+		auto inPixelIterator1 = std::begin(inRows1);
+
+		for (auto & outPixel : outRow)
+		{
+			auto const & inPixel00 = *inPixelIterator0++;
+			auto const & inPixel01 = *inPixelIterator0++;
+			auto const & inPixel10 = *inPixelIterator1++;
+			auto const & inPixel11 = *inPixelIterator1++;
+
+			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+			{
+				outPixel[componentIndex] = std::min(
+					std::min(inPixel00[componentIndex], inPixel01[componentIndex], compare),
+					std::min(inPixel10[componentIndex], inPixel11[componentIndex], compare),
+					compare);
+			}
+		}
+
+		assert(inPixelIterator0 == std::end(inRows0));
+		assert(inPixelIterator1 == std::end(inRows1));
+	}
+
+	// as above but for rows of 16-bit grey-scale values stored as little-endian Words
+	template <typename Compare>
+	void selectGrey16(
+		Row<2> const & inRows0,
+		Row<2> const & inRows1,
+		Row<2> & outRow,
+		Compare compare)
+	{
+		assert(inRows0.size() == inRows1.size());
+		assert(inRows0.size() == outRow.size() * 2);
+
+		auto inPixelIterator0 = std::begin(inRows0);
+		auto inPixelIterator1 = std::begin(inRows1);
+
+		auto value = [](Pixel<2> const & pixel)
+		{
+			return Word(pixel[0] | (pixel[1] << 8));
+		};
+
+		for (auto & outPixel : outRow)
+		{
+			auto value0 = std::min(value(inPixelIterator0[0]), value(inPixelIterator0[1]), compare);
+			auto value1 = std::min(value(inPixelIterator1[0]), value(inPixelIterator1[1]), compare);
+			auto selected = std::min(value0, value1, compare);
+			inPixelIterator0 += 2;
+			inPixelIterator1 += 2;
+
+			outPixel[0] = static_cast<Byte>(selected);
+			outPixel[1] = static_cast<Byte>(selected >> 8);
+		}
+
+		assert(inPixelIterator0 == std::end(inRows0));
+		assert(inPixelIterator1 == std::end(inRows1));
+	}
+
+	// average each horizontal pair of pixels in inRow; used when only the width is halved
+	template <int numComponents>
+	void convertHorizontal(
+		Row<numComponents> const & inRow,
+		Row<numComponents> & outRow)
+	{
+		assert(inRow.size() == outRow.size() * 2);
+
+		auto inPixelIterator = std::begin(inRow);
+
+		for (auto & outPixel : outRow)
+		{
+			auto const & inPixel0 = *inPixelIterator++;
+			auto const & inPixel1 = *inPixelIterator++;
+
+			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+			{
+				outPixel[componentIndex] = static_cast<Byte>((inPixel0[componentIndex] + inPixel1[componentIndex] + 1) >> 1);
+			}
+		}
+
+		assert(inPixelIterator == std::end(inRow));
+	}
+
+	// average each vertical pair of pixels in inRow0 and inRow1; used when only the height is halved
+	template <int numComponents>
+	void convertVertical(
+		Row<numComponents> const & inRow0,
+		Row<numComponents> const & inRow1,
+		Row<numComponents> & outRow)
+	{
+		assert(inRow0.size() == inRow1.size());
+		assert(inRow0.size() == outRow.size());
+
+		auto inPixelIterator0 = std::begin(inRow0);
+		auto inPixelIterator1 = std::begin(inRow1);
+
+		for (auto & outPixel : outRow)
+		{
+			auto const & inPixel0 = *inPixelIterator0++;
+			auto const & inPixel1 = *inPixelIterator1++;
+
+			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+			{
+				outPixel[componentIndex] = static_cast<Byte>((inPixel0[componentIndex] + inPixel1[componentIndex] + 1) >> 1);
+			}
+		}
+	}
+
+	// fixed-point weights of the three input pixels, starting at twice the output index,
+	// which make up each output pixel along one axis
+	typedef std::array<DWord, 3> PolyphaseWeights;
+	auto const polyphaseUnit = DWord(1) << 14;
+
+	// an odd number of input pixels, 2n+1, is reduced to n pixels, the ith of which weights its taps
+	// by (n-i, n, i+1)/(2n+1) so that every input pixel contributes equally; a single pixel is kept as it is
+	std::vector<PolyphaseWeights> polyphaseWeights(int inSize)
+	{
+		assert(inSize & 1);
+
+		auto outSize = std::max(inSize >> 1, 1);
+		std::vector<PolyphaseWeights> weights(outSize);
+
+		for (auto outIndex = 0; outIndex != outSize; ++outIndex)
+		{
+			auto & taps = weights[outIndex];
+			if (inSize == 1)
+			{
+				taps[0] = polyphaseUnit;
+				taps[1] = taps[2] = 0;
+			}
+			else
+			{
+				auto divisor = DWord(inSize);
+				taps[0] = (((inSize >> 1) - outIndex) * polyphaseUnit + divisor / 2) / divisor;
+				taps[2] = ((outIndex + 1) * polyphaseUnit + divisor / 2) / divisor;
+				taps[1] = polyphaseUnit - taps[0] - taps[2];
+			}
+		}
+
+		return weights;
+	}
+
+	// filter three input rows to outRow using the polyphase weights of the output row and of each column
+	// where both axes are odd; each column is filtered vertically once, at eight bits more than the pixels,
+	// and the last column of each output pixel is carried over as the first of the next
+	template <int numComponents>
+	void convertPolyphase(
+		Row<numComponents> const * (& inRows)[3],
+		PolyphaseWeights const & rowWeights,
+		std::vector<PolyphaseWeights> const & columnWeights,
+		Row<numComponents> & outRow)
+	{
+		assert(inRows[0]->size() >= outRow.size() * 2 + 1);
+		assert(columnWeights.size() == outRow.size());
+
+		auto const verticalShift = 6;
+		auto const horizontalShift = 22;
+
+		auto const rowWeight0 = rowWeights[0];
+		auto const rowWeight1 = rowWeights[1];
+		auto const rowWeight2 = rowWeights[2];
+		auto inPixelIterator0 = inRows[0]->data();
+		auto inPixelIterator1 = inRows[1]->data();
+		auto inPixelIterator2 = inRows[2]->data();
+		auto weightsIterator = std::begin(columnWeights);
+
+		// filter one component of the column the given number of pixels along from the iterators
+		auto filterColumn = [&](int offset, int componentIndex) -> Word
+		{
+			auto sum = (DWord(1) << (verticalShift - 1))
+				+ rowWeight0 * inPixelIterator0[offset][componentIndex]
+				+ rowWeight1 * inPixelIterator1[offset][componentIndex]
+				+ rowWeight2 * inPixelIterator2[offset][componentIndex];
+			return static_cast<Word>(sum >> verticalShift);
+		};
+
+		Accumulator<numComponents> carried;
+		for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+		{
+			carried[componentIndex] = filterColumn(0, componentIndex);
+		}
+
+		for (auto & outPixel : outRow)
+		{
+			auto const & weights = *weightsIterator++;
+			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+			{
+				auto filtered1 = filterColumn(1, componentIndex);
+				auto filtered2 = filterColumn(2, componentIndex);
+				auto sum = (DWord(1) << (horizontalShift - 1))
+					+ weights[0] * carried[componentIndex]
+					+ weights[1] * filtered1
+					+ weights[2] * filtered2;
+				outPixel[componentIndex] = static_cast<Byte>(sum >> horizontalShift);
+				carried[componentIndex] = filtered2;
+			}
+
+			inPixelIterator0 += 2;
+			inPixelIterator1 += 2;
+			inPixelIterator2 += 2;
+		}
+	}
 
+	// as above but where only the width is odd; each pair of rows is box-filtered as the three columns are weighted
+	// and the sum of the last column is carried over as the first of the next output pixel
 	template <int numComponents>
-	void convert(
+	void convertPolyphaseColumns(
 		Row<numComponents> const & inRows0,
 		Row<numComponents> const & inRows1,
+		std::vector<PolyphaseWeights> const & columnWeights,
 		Row<numComponents> & outRow)
 	{
 		assert(inRows0.size() == inRows1.size());
-		assert(inRows0.size() == outRow.size() * 2);
+		assert(inRows0.size() >= outRow.size() * 2 + 1);
+		assert(columnWeights.size() == outRow.size());
 
-		auto inPixelIterator0 = std::begin(inRows0);
-		auto inPixelIterator1 = std::begin(inRows1);
-		auto outPixelIterator = std::begin(outRow);
+		// the sums of each pair carry one bit more than the pixels
+		auto const horizontalShift = 15;
 
-		while (inPixelIterator0 != std::end(inRows0))
-		{
-			// accumulates component values from the four input pixels
-			Accumulator<numComponents> accumulator;
+		auto inPixelIterator0 = inRows0.data();
+		auto inPixelIterator1 = inRows1.data();
+		auto weightsIterator = std::begin(columnWeights);
 
-			// initialize accumulator with a .5 value;
-			// facilitates round-to-nearest behavior
-			auto const accumulatedUnit = 4;
-			auto const accumulatedHalf = accumulatedUnit / 2;
-			std::fill(std::begin(accumulator), std::end(accumulator), accumulatedHalf);
+		Accumulator<numComponents> carried;
+		for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
+		{
+			carried[componentIndex] = Word(inPixelIterator0[0][componentIndex] + inPixelIterator1[0][componentIndex]);
+		}
 
-			auto accumulate = [&](Pixel<numComponents> pixel)
+		for (auto & outPixel : outRow)
+		{
+			auto const & weights = *weightsIterator++;
+			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
 			{
-				for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
-				{
-					accumulator[componentIndex] += pixel[componentIndex];
-				}
-			};
+				auto sum1 = DWord(inPixelIterator0[1][componentIndex] + inPixelIterator1[1][componentIndex]);
+				auto sum2 = DWord(inPixelIterator0[2][componentIndex] + inPixelIterator1[2][componentIndex]);
+				auto sum = (DWord(1) << (horizontalShift - 1))
+					+ weights[0] * carried[componentIndex]
+					+ weights[1] * sum1
+					+ weights[2] * sum2;
+				outPixel[componentIndex] = static_cast<Byte>(sum >> horizontalShift);
+				carried[componentIndex] = Word(sum2);
+			}
 
-			accumulate(*inPixelIterator0++);
-			accumulate(*inPixelIterator0++);
-			accumulate(*inPixelIterator1++);
-			accumulate(*inPixelIterator1++);
+			inPixelIterator0 += 2;
+			inPixelIterator1 += 2;
+		}
+	}
 
-			Pixel<numComponents> outPixel;
+	// as above but where only the height is odd; each pair of columns is box-filtered as the three rows are weighted
+	template <int numComponents>
+	void convertPolyphaseRows(
+		Row<numComponents> const * (& inRows)[3],
+		PolyphaseWeights const & rowWeights,
+		Row<numComponents> & outRow)
+	{
+		assert(inRows[0]->size() >= outRow.size() * 2);
+
+		// the sums of each pair carry one bit more than the pixels
+		auto const verticalShift = 15;
+
+		auto const rowWeight0 = rowWeights[0];
+		auto const rowWeight1 = rowWeights[1];
+		auto const rowWeight2 = rowWeights[2];
+		auto inPixelIterator0 = inRows[0]->data();
+		auto inPixelIterator1 = inRows[1]->data();
+		auto inPixelIterator2 = inRows[2]->data();
+
+		for (auto & outPixel : outRow)
+		{
 			for (auto componentIndex = 0; componentIndex != numComponents; ++componentIndex)
 			{
-				outPixel[componentIndex] = accumulator[componentIndex] >> 2;
+				auto sum = (DWord(1) << (verticalShift - 1))
+					+ rowWeight0 * DWord(inPixelIterator0[0][componentIndex] + inPixelIterator0[1][componentIndex])
+					+ rowWeight1 * DWord(inPixelIterator1[0][componentIndex] + inPixelIterator1[1][componentIndex])
+					+ rowWeight2 * DWord(inPixelIterator2[0][componentIndex] + inPixelIterator2[1][componentIndex]);
+				outPixel[componentIndex] = static_cast<Byte>(sum >> verticalShift);
 			}
 
-			*outPixelIterator++ = outPixel;
+			inPixelIterator0 += 2;
+			inPixelIterator1 += 2;
+			inPixelIterator2 += 2;
 		}
+	}
 
-		assert(inPixelIterator0 == std::end(inRows0));
-		assert(inPixelIterator1 == std::end(inRows1));
-		assert(outPixelIterator == std::end(outRow));
+	// reduce a pair of input rows to outRow using the given single-output reduction
+	template <int numComponents>
+	void reduce(
+		Row<numComponents> const & inRows0,
+		Row<numComponents> const & inRows1,
+		Row<numComponents> & outRow,
+		Reduction reduction,
+		Options const & options)
+	{
+		switch (reduction)
+		{
+		case Reduction::average:
+			convert(inRows0, inRows1, outRow);
+			break;
+
+		case Reduction::minimum:
+			select(inRows0, inRows1, outRow, std::less<Byte>());
+			break;
+
+		case Reduction::maximum:
+			select(inRows0, inRows1, outRow, std::greater<Byte>());
+			break;
+
+		case Reduction::normalMap:
+			convertNormals(inRows0, inRows1, outRow, options.toksvig);
+			break;
+
+		default:
+			assert(false);
+		}
+	}
+
+	void reduce(
+		Row<2> const & inRows0,
+		Row<2> const & inRows1,
+		Row<2> & outRow,
+		Reduction reduction,
+		Options const & options)
+	{
+		if (!options.grey16)
+		{
+			reduce<2>(inRows0, inRows1, outRow, reduction, options);
+			return;
+		}
+
+		switch (reduction)
+		{
+		case Reduction::average:
+			convertGrey16(inRows0, inRows1, outRow);
+			break;
+
+		case Reduction::minimum:
+			selectGrey16(inRows0, inRows1, outRow, std::less<Word>());
+			break;
+
+		case Reduction::maximum:
+			selectGrey16(inRows0, inRows1, outRow, std::greater<Word>());
+			break;
+
+		default:
+			assert(false);
+		}
+	}
+
+	// store each pair of pixels from inRow0 and inRow1 side by side as one pixel of outRow,
+	// e.g. the minimum and maximum of a block as two components
+	template <int inComponents, int outComponents>
+	Row<outComponents> const & interleave(
+		Row<inComponents> const & inRow0,
+		Row<inComponents> const & inRow1,
+		Row<outComponents> & outRow)
+	{
+		assert(outComponents == inComponents * 2);
+		assert(inRow0.size() == outRow.size());
+		assert(inRow1.size() == outRow.size());
+
+		auto inPixelIterator0 = std::begin(inRow0);
+		auto inPixelIterator1 = std::begin(inRow1);
+		for (auto & outPixel : outRow)
+		{
+			auto const & inPixel0 = *inPixelIterator0++;
+			auto const & inPixel1 = *inPixelIterator1++;
+			std::copy(std::begin(inPixel0), std::end(inPixel0), std::begin(outPixel));
+			std::copy(std::begin(inPixel1), std::end(inPixel1), std::begin(outPixel) + inComponents);
+		}
+
+		return outRow;
 	}
 
+	// rescale the alpha of the output pixels which have already been written to outFile
+	// from the given position, using row as a buffer
 	template <int numComponents>
+	void preserveCoverage(FILE * outFile, FilePosition outPixelsPosition, int numRows, Row<numComponents> & row, AlphaCoverage const & coverage)
+	{
+		auto cutoff = coverage.cutoff();
+		if (cutoff == coverage.getThreshold())
+		{
+			return;
+		}
+
+		auto rowSize = FilePosition(row.size() * sizeof(Pixel<numComponents>));
+		auto outPixelsEnd = tell(outFile, ExitStatus::badOutputFile);
+
+		// an update stream must seek between reading and writing
+		for (auto rowPosition = outPixelsPosition; numRows; --numRows, rowPosition += rowSize)
+		{
+			seek(outFile, rowPosition, ExitStatus::badOutputFile);
+			readObjects(outFile, row.data(), row.size(), ExitStatus::badOutputFile);
+			coverage.apply(row, cutoff);
+
+			seek(outFile, rowPosition, ExitStatus::badOutputFile);
+			writeRow(outFile, row);
+		}
+
+		seek(outFile, outPixelsEnd, ExitStatus::badOutputFile);
+	}
+
+	template <int numComponents, int outComponents>
 	void convert(
 		FILE * inFile,
 		FILE * outFile,
 		Header::Specification inSpecification,
-		Header::Specification outSpecification)
+		Header::Specification outSpecification,
+		Region region,
+		OutputFormat const & format,
+		Options const & options,
+		Extensions & extensions)
 	{
+		typedef Row<outComponents> OutRow;
 		typedef Row<numComponents> Row;
+		typedef PostageStamp<outComponents> PostageStamp;
+
+		// an axis which was not chosen, or which is a single pixel already, is not halved;
+		// reductions without one-dimensional kernels duplicate the pixel instead
+		auto halveWidth = outSpecification.width != region.width || !hasAxisKernels(options);
+		auto halveHeight = outSpecification.height != region.height || !hasAxisKernels(options);
+
+		auto inWidthComplete = region.width;
+		auto inWidthRup = halveWidth ? (inWidthComplete + 1) & (~1u) : inWidthComplete;
 
-		auto inWidthComplete = inSpecification.width;
-		auto inWidthRup = (inWidthComplete + 1) & (~1u);
+		// polyphase filtering is only needed along an odd axis; even axes are box-filtered the same either way
+		auto polyphaseColumns = options.polyphase && (region.width & 1);
+		auto polyphaseRows = options.polyphase && (region.height & 1);
 
-		auto outColumnsRup = (inSpecification.width + 1) >> 1;
-		auto outRowsComplete = inSpecification.height >> 1;
+		auto outColumnsRup = polyphaseColumns ? outSpecification.width : halveWidth ? (region.width + 1) >> 1 : region.width;
+		auto outRowsComplete = region.height >> 1;
+
+		// only the Bytes within region are read; the rest are skipped
+		auto rowSize = long(inSpecification.width) * numComponents;
+		auto leftSize = long(region.x) * numComponents;
+		auto rightSize = rowSize - leftSize - long(region.width) * numComponents;
+
+		AlphaCoverage coverage(options.alphaThreshold);
+
+		auto readRegionRow = [&](Row & row)
+		{
+			skip(inFile, leftSize);
+			readRow(inFile, row, region.width);
+			skip(inFile, rightSize);
+
+			if (options.alphaThreshold)
+			{
+				coverage.addInput(row, region.width);
+			}
+		};
 
 		Row inRow0(inWidthRup), inRow1(inWidthRup), outRow(outColumnsRup);
+		OutRow storedOutRow(outColumnsRup);
+
+		// minmax reduces each block twice; minima go in outRow and maxima here
+		Row maxRow(options.reduction == Reduction::minMax ? outColumnsRup : 0);
+
+		// bleeding also draws on the last input row of the previous pair, which is kept here
+		Row aboveRow(options.bleed ? inWidthRup : 0);
+		Row const * bleedAboveRow = nullptr;
+
 		assert((reinterpret_cast<char const *>(&inRow0.back()) - reinterpret_cast<char const *>(&inRow0.front())) == (inWidthRup - 1) * numComponents);
 		assert((reinterpret_cast<char const *>(&inRow1.back()) - reinterpret_cast<char const *>(&inRow1.front())) == (inWidthRup - 1) * numComponents);
-		assert((reinterpret_cast<char const *>(&outRow.back()) - reinterpret_cast<char const *>(&outRow.front())) == (inWidthRup / 2 - 1) * numComponents);
+		assert((reinterpret_cast<char const *>(&outRow.back()) - reinterpret_cast<char const *>(&outRow.front())) == (outColumnsRup - 1) * numComponents);
+
+		auto columnWeights = polyphaseColumns ? polyphaseWeights(region.width) : std::vector<PolyphaseWeights>();
+
+		auto reduceRows = [&](Row const & inRows0, Row const & inRows1)
+		{
+			if (!halveWidth)
+			{
+				convertVertical(inRows0, inRows1, outRow);
+			}
+			else if (!halveHeight)
+			{
+				convertHorizontal(inRows0, outRow);
+			}
+			else if (polyphaseColumns)
+			{
+				convertPolyphaseColumns(inRows0, inRows1, columnWeights, outRow);
+			}
+			else if (options.reduction == Reduction::minMax)
+			{
+				reduce(inRows0, inRows1, outRow, Reduction::minimum, options);
+				reduce(inRows0, inRows1, maxRow, Reduction::maximum, options);
+			}
+			else if (options.bleed && numComponents % 2 == 0)
+			{
+				convertBleed(inRows0, inRows1, bleedAboveRow, outRow);
+			}
+			else
+			{
+				reduce(inRows0, inRows1, outRow, options.reduction, options);
+			}
+		};
+
+		PostageStamp stamp(outSpecification.width, outSpecification.height);
+
+		// store outRow in the output format and write it along with anything else which is derived from it
+		auto outRowIndex = 0;
+		auto emit = [&](Tracer::Clock::time_point start)
+		{
+			auto const & storedRow = options.reduction == Reduction::minMax
+				? interleave(outRow, maxRow, storedOutRow)
+				: storeRow(outRow, storedOutRow, format, outRowIndex);
+			++outRowIndex;
+			start = tracer.record("store", start);
+
+			writeRow(outFile, storedRow);
+			start = tracer.record("write", start);
+
+			if (options.alphaThreshold)
+			{
+				coverage.addOutput(storedRow);
+			}
+
+			if (options.postageStamp)
+			{
+				stamp.add(storedRow);
+				tracer.record("stamp", start);
+			}
+		};
+
+		for (auto i = region.y; i; --i)
+		{
+			skip(inFile, rowSize);
+		}
+
+		auto outPixelsPosition = tell(outFile, ExitStatus::badOutputFile);
+
+		if (polyphaseRows)
+		{
+			// a window of the last three input rows read; output row i filters input rows 2i to 2i+2;
+			// two pixels of padding stand in for the zero-weighted taps past the end of a row one pixel wide
+			Row windowRow0(region.width + 2), windowRow1(region.width + 2), windowRow2(region.width + 2);
+			Row * window[] = { &windowRow0, &windowRow1, &windowRow2 };
+
+			auto rowWeights = polyphaseWeights(region.height);
+
+			auto numRowsRead = 0;
+			for (auto filteredRowIndex = 0; filteredRowIndex != outSpecification.height; ++filteredRowIndex)
+			{
+				auto start = tracer.now();
+				Row const * inRows[3];
+				for (auto tap = 0; tap != 3; ++tap)
+				{
+					auto inRowIndex = std::min(filteredRowIndex * 2 + tap, region.height - 1);
+					for (; numRowsRead <= inRowIndex; ++numRowsRead)
+					{
+						readRegionRow(*window[numRowsRead % 3]);
+					}
+
+					inRows[tap] = window[inRowIndex % 3];
+				}
+				start = tracer.record("read", start);
+
+				if (polyphaseColumns)
+				{
+					convertPolyphase(inRows, rowWeights[filteredRowIndex], columnWeights, outRow);
+				}
+				else
+				{
+					convertPolyphaseRows(inRows, rowWeights[filteredRowIndex], outRow);
+				}
+				start = tracer.record("convert", start);
+
+				emit(start);
+			}
+		}
+
+		// each row is reduced alone
+		for (auto i = (halveHeight || polyphaseRows) ? 0 : region.height; i; --i)
+		{
+			auto start = tracer.now();
+			readRegionRow(inRow0);
+			start = tracer.record("read", start);
+
+			reduceRows(inRow0, inRow0);
+			start = tracer.record("convert", start);
+
+			emit(start);
+		}
 
-		for (auto i = outRowsComplete; i; --i)
+		for (auto i = (halveHeight && !polyphaseRows) ? outRowsComplete : 0; i; --i)
 		{
-			readRow(inFile, inRow0, inSpecification.width);
-			readRow(inFile, inRow1, inSpecification.width);
+			auto start = tracer.now();
+			readRegionRow(inRow0);
+			readRegionRow(inRow1);
+			start = tracer.record("read", start);
 
-			convert(inRow0, inRow1, outRow);
+			reduceRows(inRow0, inRow1);
+			if (options.bleed)
+			{
+				aboveRow.swap(inRow1);
+				bleedAboveRow = &aboveRow;
+			}
+			start = tracer.record("convert", start);
 
-			writeRow(outFile, outRow);
+			emit(start);
 		}
 
 		// convert outstanding odd row
-		if (inSpecification.height & 1)
+		if (halveHeight && !polyphaseRows && (region.height & 1))
+		{
+			auto start = tracer.now();
+			readRegionRow(inRow0);
+			start = tracer.record("read", start);
+
+			reduceRows(inRow0, inRow0);
+			start = tracer.record("convert", start);
+
+			emit(start);
+		}
+
+		for (auto i = inSpecification.height - region.y - region.height; i; --i)
+		{
+			skip(inFile, rowSize);
+		}
+
+		if (options.alphaThreshold)
+		{
+			auto start = tracer.now();
+			preserveCoverage(outFile, outPixelsPosition, outSpecification.height, storedOutRow, coverage);
+			tracer.record("coverage", start);
+		}
+
+		if (options.postageStamp)
+		{
+			extensions.postageStamp = stamp.serialize();
+		}
+	}
+
+	template <int numComponents>
+	void convert(
+		FILE * inFile,
+		FILE * outFile,
+		Header::Specification inSpecification,
+		Header::Specification outSpecification,
+		Region region,
+		OutputFormat const & format,
+		Options const & options,
+		Extensions & extensions)
+	{
+		switch (outSpecification.bpp)
 		{
-			readRow(inFile, inRow0, inSpecification.width);
+		case 8:
+			convert<numComponents, 1>(inFile, outFile, inSpecification, outSpecification, region, format, options, extensions);
+			break;
+
+		case 16:
+			convert<numComponents, 2>(inFile, outFile, inSpecification, outSpecification, region, format, options, extensions);
+			break;
 
-			convert(inRow0, inRow0, outRow);
+		case 24:
+			convert<numComponents, 3>(inFile, outFile, inSpecification, outSpecification, region, format, options, extensions);
+			break;
+
+		case 32:
+			convert<numComponents, 4>(inFile, outFile, inSpecification, outSpecification, region, format, options, extensions);
+			break;
 
-			writeRow(outFile, outRow);
+		default:
+			assert(false);
 		}
 	}
 
-	void convert(FILE * inFile, FILE * outFile)
+	void convert(FILE * inFile, FILE * outFile, Options const & options)
 	{
+		auto start = tracer.now();
+
 		// read input header
 		auto inHeader = readObject<Header>(inFile);
 		inspect(inHeader);
 
+		// 2x2 blocks are aligned to the corner of the region, even when its offset is odd
+		auto region = options.crop;
+		if (!region.width)
+		{
+			region.x = region.y = 0;
+			region.width = inHeader.specification.width;
+			region.height = inHeader.specification.height;
+		}
+		enforce(region.x + region.width <= inHeader.specification.width, ExitStatus::badCrop);
+		enforce(region.y + region.height <= inHeader.specification.height, ExitStatus::badCrop);
+
+		// a single pixel halves to itself so the output size alone tells which axes are reduced
+		auto halveWidth = options.axes != Axes::y;
+		auto halveHeight = options.axes != Axes::x;
+
 		// copy header
 		auto outHeader = inHeader;
-		outHeader.specification.xOrigin = inHeader.specification.xOrigin >> 1;
-		outHeader.specification.yOrigin = inHeader.specification.yOrigin >> 1;
-		outHeader.specification.height = (inHeader.specification.height + 1) >> 1;
-		outHeader.specification.width = (inHeader.specification.width + 1) >> 1;
+		outHeader.specification.xOrigin = (inHeader.specification.xOrigin + region.x) >> (halveWidth ? 1 : 0);
+		outHeader.specification.yOrigin = (inHeader.specification.yOrigin + region.y) >> (halveHeight ? 1 : 0);
+		outHeader.specification.height = halveHeight ? (region.height + 1) >> 1 : region.height;
+		outHeader.specification.width = halveWidth ? (region.width + 1) >> 1 : region.width;
+		if (options.polyphase)
+		{
+			outHeader.specification.height = std::max(region.height >> 1, 1);
+			outHeader.specification.width = std::max(region.width >> 1, 1);
+		}
+
+		enforce(!options.grey16 || inHeader.specification.bpp == 16, ExitStatus::unsupportedInputFormat);
+
+		enforce(options.reduction != Reduction::normalMap || inHeader.specification.bpp >= 24, ExitStatus::unsupportedInputFormat);
+		enforce(!options.toksvig || inHeader.specification.bpp == 32, ExitStatus::unsupportedInputFormat);
+		enforce(!options.alphaThreshold || (inHeader.specification.bpp % 16 == 0 && !options.grey16), ExitStatus::unsupportedInputFormat);
+		enforce(!options.bleed || (inHeader.specification.bpp % 16 == 0 && !options.grey16), ExitStatus::unsupportedInputFormat);
+
+		// choose output format
+		OutputFormat format;
+		format.lumaWeights = lumaWeights(options.lumaStandard);
+		format.dither = options.dither;
+		std::fill(std::begin(format.sources), std::end(format.sources), swizzleOne);
+
+		switch (options.packedFormat)
+		{
+		case 565:
+			format.packing = Packing::rgb565;
+			break;
+		case 4444:
+			format.packing = Packing::argb4444;
+			break;
+		case 1555:
+			format.packing = Packing::argb1555;
+			break;
+		default:
+			format.packing = Packing::none;
+			break;
+		}
+
+		// number of components before any packing
+		auto inComponents = inHeader.specification.bpp / 8;
+		auto outComponents = options.packedFormat
+			? options.packedFormat == 565 ? 3 : 4
+			: options.outBpp
+			? options.outBpp / 8
+			: options.swizzle ? int(std::strlen(options.swizzle)) : options.grey ? 1 : inComponents;
+		auto swizzlePattern = options.swizzle ? options.swizzle : naturalSwizzle(outComponents);
+
+		enforce(int(std::strlen(swizzlePattern)) == outComponents, ExitStatus::badSwizzle);
+		enforce(parseSwizzle(swizzlePattern, inComponents, format), ExitStatus::badSwizzle);
+
+		if (options.reduction == Reduction::minMax)
+		{
+			// minima and maxima sit side by side; a pair of 16-bit values fills a 32-bit true-color pixel
+			enforce(inComponents == 1 || options.grey16, ExitStatus::unsupportedInputFormat);
+			outHeader.type = inComponents == 1 ? Header::ImageType::uncompressedGrayScaleImage : Header::ImageType::uncompressedTrueColorImage;
+			outHeader.specification.bpp = Byte(inComponents * 16);
+			outHeader.specification.descriptor.attributeBits = 8;
+		}
+		else if (format.packing != Packing::none)
+		{
+			// 565 and 4444 are not TGA formats but share the container of the 1555 format
+			outHeader.type = Header::ImageType::uncompressedTrueColorImage;
+			outHeader.specification.bpp = 16;
+			outHeader.specification.descriptor.attributeBits = format.packing == Packing::argb4444 ? 4 : format.packing == Packing::argb1555 ? 1 : 0;
+		}
+		else if (outComponents != inComponents)
+		{
+			outHeader.type = outComponents <= 2 ? Header::ImageType::uncompressedGrayScaleImage : Header::ImageType::uncompressedTrueColorImage;
+			outHeader.specification.bpp = Byte(outComponents * 8);
+			outHeader.specification.descriptor.attributeBits = (outComponents & 1) ? 0 : 8;
+		}
 
 		// write output header
 		writeObject(outFile, outHeader);
@@ -350,68 +2542,105 @@ namespace
 		auto begin = idField.data();
 		readObjects(inFile, begin, idLength);
 		writeObjects(outFile, begin, idLength);
+		tracer.record("header", start);
 
 		// copy pixels
+		Extensions extensions;
 		switch (inHeader.specification.bpp)
 		{
 		case 8:
 			enforce(inHeader.type == Header::ImageType::uncompressedGrayScaleImage, ExitStatus::unsupportedInputFormat);
-			convert<1>(inFile, outFile, inHeader.specification, outHeader.specification);
+			convert<1>(inFile, outFile, inHeader.specification, outHeader.specification, region, format, options, extensions);
 			break;
 
 		case 16:
 			enforce(inHeader.type == Header::ImageType::uncompressedGrayScaleImage, ExitStatus::unsupportedInputFormat);
-			convert<2>(inFile, outFile, inHeader.specification, outHeader.specification);
+			convert<2>(inFile, outFile, inHeader.specification, outHeader.specification, region, format, options, extensions);
 			break;
 
 		case 24:
 			enforce(inHeader.type == Header::ImageType::uncompressedTrueColorImage, ExitStatus::unsupportedInputFormat);
-			convert<3>(inFile, outFile, inHeader.specification, outHeader.specification);
+			convert<3>(inFile, outFile, inHeader.specification, outHeader.specification, region, format, options, extensions);
 			break;
 
 		case 32:
 			enforce(inHeader.type == Header::ImageType::uncompressedTrueColorImage, ExitStatus::unsupportedInputFormat);
-			convert<4>(inFile, outFile, inHeader.specification, outHeader.specification);
+			convert<4>(inFile, outFile, inHeader.specification, outHeader.specification, region, format, options, extensions);
 			break;
 
 		default:
 			fail(ExitStatus::unsupportedInputFormat);
 		}
 
-		while (!std::feof(inFile))
-		{
-			fputc(fgetc(inFile), outFile);
-		}
-
-		assert(std::feof(inFile));
+		// copy trailer
+		start = tracer.now();
+		auto pixelsPreserved = outHeader.specification.bpp == inHeader.specification.bpp
+			&& options.reduction != Reduction::minMax
+			&& preservesPixels(format, inComponents);
+		// the stamp is stored in the input pixel format and depicts the whole input with its proportions
+		auto widthReduced = outHeader.specification.width != region.width;
+		auto heightReduced = outHeader.specification.height != region.height;
+		auto stampPreserved = pixelsPreserved
+			&& region.width == inHeader.specification.width
+			&& region.height == inHeader.specification.height
+			&& widthReduced == heightReduced;
+		copyTrailer(inFile, outFile, pixelsPreserved, stampPreserved, widthReduced, heightReduced, outHeader.specification.descriptor.attributeBits,
+			options.postageStamp ? &extensions.postageStamp : nullptr);
+		tracer.record("trailer", start);
 	}
 
-	void convert(char const * inFilename, char const * outFilename)
+	void convert(Options const & options)
 	{
-		FILE * inFile = std::fopen(inFilename, "rb");
+		auto const bytesPerMegabyte = 1000000.;
+		ioRateLimiter.setRate(options.ioRate * bytesPerMegabyte);
+
+		if (options.traceFilename)
+		{
+			tracer.enable();
+		}
+
+		FILE * inFile = std::fopen(options.inFilename, "rb");
 		if (!inFile)
 		{
 			fail(ExitStatus::badInputFile);
 		}
 
-		FILE * outFile = std::fopen(outFilename, "wb");
+		// output is written under a temporary name and only moved into place once complete
+		// so that a run which is interrupted or fails never leaves a truncated output behind;
+		// it is opened for update so that alpha can be rescaled once all rows are written
+		auto tempFilename = createTempFile(options.outFilename);
+		partialFilename = tempFilename;
+
+		FILE * outFile = std::fopen(tempFilename.c_str(), "w+b");
 		if (!outFile)
 		{
 			fail(ExitStatus::badOutputFile);
 		}
+		partialFile = outFile;
+
+		convert(inFile, outFile, options);
+
+		std::fclose(inFile);
+		partialFile = nullptr;
+		enforce(std::fclose(outFile) == 0, ExitStatus::badOutputFile);
+		ioRateLimiter.flush();
+
+		// unlike rename, replaces any existing output in one step
+		enforce(MoveFileExA(tempFilename.c_str(), options.outFilename, MOVEFILE_REPLACE_EXISTING) != 0, ExitStatus::badOutputFile);
+		partialFilename.clear();
 
-		convert(inFile, outFile);
+		if (options.traceFilename)
+		{
+			enforce(tracer.write(options.traceFilename), ExitStatus::badOutputFile);
+		}
 	}
 }
 
 int main(int numArgs, char * args[])
 {
-	if (numArgs != 3)
-	{
-		fail(ExitStatus::badArgs);
-	}
+	auto options = parseOptions(numArgs, args);
 
-	convert(args[1], args[2]);
+	convert(options);
 
 	return static_cast<int>(ExitStatus::ok);
 }